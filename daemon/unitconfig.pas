@@ -68,6 +68,10 @@ type
     dualshock4_static_color_red: longint;
     dualshock4_static_color_green: longint;
     dualshock4_static_color_blue: longint;
+
+    // metrics
+    metrics_enabled: boolean;
+    metrics_socket: ansistring;
   end;
 
 function ReadSettings: boolean;
@@ -127,6 +131,9 @@ begin
     _settings.dualshock4_static_color_green := inifile.ReadInteger('dualshock4', 'static_color_green', -1);
     _settings.dualshock4_static_color_blue := inifile.ReadInteger('dualshock4', 'static_color_blue', -1);
 
+    _settings.metrics_enabled := inifile.ReadBool('metrics', 'enabled', false);
+    _settings.metrics_socket := inifile.ReadString('metrics', 'socket', '');
+
     // Now validate them
     if _settings.system_ondelay = -1 then begin
       raise exception.Create('system / ondelay is missing');
@@ -207,6 +214,13 @@ begin
       end;
     end;
 
+    if _settings.metrics_enabled then begin
+      if _settings.metrics_socket = '' then begin
+        raise exception.Create('metrics / socket is missing (if you do not want to use this functionality, set metrics / enabled to 0)');
+        exit;
+      end;
+    end;
+
     freeandnil(inifile);
   except
     on e: exception do begin
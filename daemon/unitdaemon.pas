@@ -32,6 +32,7 @@ uses
   unix,
   baseunix,
   unitconfig,
+  unitmetrics,
   rpigpio;
 
 // Yes it could be done neater by using a linked list or so, but since we will
@@ -63,6 +64,7 @@ type
       DS4BatteryLowTimer: tltimer;
       lastConfigCheckTime: tunixtimeint;
       DS4BatteryPollCounter: longint;
+      metrics: tmetrics;
 
       ds4controller: array[0..MAX_DS4_CONTROLLERS - 1] of rDualShock4;
 
@@ -98,8 +100,10 @@ uses process, unitglobal;
 procedure tdaemon.DS4BatteryLowTimerEvent(Sender: TObject);
 var
   i: longint;
+  started: int64;
 begin
   self.DS4BatteryLowTimer.enabled := false;
+  started := self.metrics.StartEvent;
 
   for i := 0 to MAX_DS4_CONTROLLERS - 1 do begin
     if self.ds4controller[i].attached then begin
@@ -127,6 +131,7 @@ begin
     end;
   end;
 
+  self.metrics.EndEvent(meDS4BatteryLow, started);
   self.DS4BatteryLowTimer.enabled := true;
 end;
 
@@ -144,6 +149,7 @@ begin
   try
     // Get the battery charge of each controller, plus the real device name
     fullpath := SYSTEM_POWER_PATH + self.ds4controller[deviceID].batteryName + DUALSHOCK4_BATTERY_CHARGE;
+    self.metrics.Count(mcSysfsReads);
     filemode := fmOpenRead;
     assignfile(t, fullpath);
     reset(t);
@@ -168,6 +174,7 @@ begin
     end;
   except
     on e: exception do begin
+      self.metrics.Count(mcSysfsFailures);
       try
         closefile(t);
       except
@@ -226,7 +233,11 @@ begin
   try
     s := SYSTEM_LED_PATH + self.ds4controller[deviceID].deviceName + DUALSHOCK4_RED_LED;
     // Check if controller vanished and bail; will be caught on next poll loop
-    if not fileexists(s) then exit;
+    if not fileexists(s) then begin
+      self.metrics.Count(mcSysfsFailures);
+      exit;
+    end;
+    self.metrics.Count(mcSysfsWrites);
     filemode := fmOpenWrite;
     assignfile(t, s);
     rewrite(t);
@@ -235,7 +246,11 @@ begin
 
     s := SYSTEM_LED_PATH + self.ds4controller[deviceID].deviceName + DUALSHOCK4_GREEN_LED;
     // Check if controller vanished and bail; will be caught on next poll loop
-    if not fileexists(s) then exit;
+    if not fileexists(s) then begin
+      self.metrics.Count(mcSysfsFailures);
+      exit;
+    end;
+    self.metrics.Count(mcSysfsWrites);
     filemode := fmOpenWrite;
     assignfile(t, s);
     rewrite(t);
@@ -244,7 +259,11 @@ begin
 
     s := SYSTEM_LED_PATH + self.ds4controller[deviceID].deviceName + DUALSHOCK4_BLUE_LED;
     // Check if controller vanished and bail; will be caught on next poll loop
-    if not fileexists(s) then exit;
+    if not fileexists(s) then begin
+      self.metrics.Count(mcSysfsFailures);
+      exit;
+    end;
+    self.metrics.Count(mcSysfsWrites);
     filemode := fmOpenWrite;
     assignfile(t, s);
     rewrite(t);
@@ -253,6 +272,7 @@ begin
   except
     on e: exception do begin
       // Controller vanished while accessing it
+      self.metrics.Count(mcSysfsFailures);
       try
         // Make sure we don't leak fds
         closefile(t);
@@ -283,9 +303,12 @@ begin
     repeat
       fullpath := SYSTEM_POWER_PATH + fileinfo.name + DUALSHOCK4_REAL_DEVICE;
       // fpReadLink might fail if the controller goes away while checking!
+      self.metrics.Count(mcSysfsReads);
       s := fpReadLink(fullpath);
       realDevice := '';
-      if s <> '' then begin
+      if s = '' then begin
+        self.metrics.Count(mcSysfsFailures);
+      end else begin
         // We need to hunt backwards for the '/' to get the real device name
         for i := length(s) downto 1 do begin
           if s[i] = '/' then begin
@@ -355,11 +378,15 @@ end;
   Timer: Check DualShock 4 battery levels and set lightbar colours
   --------------------------------------------------------------------------- }
 procedure tdaemon.DS4CheckTimerEvent(Sender: TObject);
+var
+  started: int64;
 begin
   self.DS4CheckTimer.enabled := false;
+  started := self.metrics.StartEvent;
 
   self.PollDualshock4Controllers;
 
+  self.metrics.EndEvent(meDS4Check, started);
   self.DS4CheckTimer.enabled := true;
 end;
 
@@ -367,12 +394,16 @@ end;
   Timer: Check for configuration file changes
   --------------------------------------------------------------------------- }
 procedure tdaemon.ConfigCheckTimerEvent(Sender: TObject);
+var
+  started: int64;
 begin
   self.configCheckTimer.enabled := false;
+  started := self.metrics.StartEvent;
 
   self.CheckConfigurationChangesSince(self.lastConfigCheckTime);
   self.lastConfigCheckTime := unixtimeint;
 
+  self.metrics.EndEvent(meConfigCheck, started);
   self.configCheckTimer.enabled := true;
 end;
 
@@ -382,8 +413,10 @@ end;
 procedure tdaemon.ButtonCheckTimerEvent(Sender: TObject);
 var
   i: longint;
+  started: int64;
 begin
   self.buttonCheckTimer.enabled := false;
+  started := self.metrics.StartEvent;
 
   // Shutdown request?
   if self.gpiodriver.readPin(_settings.gpio_powerdown) then begin
@@ -430,6 +463,7 @@ begin
     end;
   end;
 
+  self.metrics.EndEvent(meButtonCheck, started);
   self.buttonCheckTimer.enabled := true;
 end;
 
@@ -528,6 +562,7 @@ begin
 
   for i := 0 to sl.count - 1 do begin
     write('[' + sl.strings[i] + ']: checking...');
+    self.metrics.Count(mcFilesChecked);
     try
       filemode := fmOpenRead;
       assignfile(infile, sl.strings[i]);
@@ -591,6 +626,7 @@ begin
         end;
         closefile(binfile);
         freeandnil(sl2);
+        self.metrics.Count(mcFilesPatched);
         writeln('patched');
       end else begin
         writeln('already fixed');
@@ -598,6 +634,7 @@ begin
     except
       on e: exception do begin
         writeln('tdaemon: Exception processing controller configuration: ' + e.message);
+        self.metrics.Count(mcFilePatchFailures);
         closefile(infile);
         if assigned(sl) then begin
           freeandnil(sl);
@@ -618,6 +655,9 @@ var
 begin
   inherited Create;
 
+  // Created first so that the boot-time configuration fixup is counted too
+  self.metrics := tmetrics.Create;
+
   // Fixup controller configurations at boot if requested
   if _settings.controller_disablehotkeys and _settings.controller_fix_at_boot then begin
     self.FixControllerConfigurationFiles;
@@ -661,7 +701,7 @@ end;
   ---------------------------------------------------------------------------- }
 destructor tdaemon.Destroy;
 begin
-  //
+  freeandnil(self.metrics);
   inherited Destroy;
 end;
 
@@ -713,6 +753,11 @@ begin
   if _settings.dualshock4_enabled then begin
     writeln('tdaemon: Monitoring DualShock 4 controllers.');
   end;
+  if _settings.metrics_enabled then begin
+    if self.metrics.Listen(_settings.metrics_socket) then begin
+      writeln('tdaemon: Serving metrics on ' + _settings.metrics_socket);
+    end;
+  end;
 
   // Enable timers
   self.buttonCheckTimer.enabled := true;
@@ -730,6 +775,9 @@ begin
   // Enter lcore message loop (will not return until the daamon shuts down)
   messageloop;
 
+  // Stop serving metrics
+  self.metrics.Shutdown;
+
   // Disable timers
   if assigned(self.DS4BatteryLowTimer) then begin
     self.DS4BatteryLowTimer.onTimer := nil;
@@ -49,6 +49,7 @@ const
   DUALSHOCK4_REAL_DEVICE = '/device';
 
   BUTTON_POLL_INTERVAL = 50;
+  METRICS_POLL_INTERVAL = 250;
 
 var
   _daemon: tdaemon;
@@ -0,0 +1,327 @@
+{ ----------------------------------------------------------------------------
+  piconsole - The Raspberry Pi retro videogame console project
+  Copyright (C) 2017  Michael Andrew Nixon
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  Contact: zipplet@zipplet.co.uk
+
+  Runtime metrics unit
+  ---------------------------------------------------------------------------- }
+unit unitmetrics;
+
+interface
+
+uses
+  sysutils,
+  classes,
+  lcore,
+  lcoreselect,
+  unix,
+  baseunix,
+  sockets;
+
+// Everything is kept in fixed size arrays in RAM. Nothing is ever written to
+// disk; the report is built on demand when a client connects to the socket.
+// Histogram bucket 0 counts events that took less than 1us, bucket n counts
+// events that took [2^(n-1), 2^n) us and the last bucket catches the rest
+// (anything over ~4 seconds, such as a held reset button).
+const
+  METRICS_HISTOGRAM_BUCKETS = 24;
+  METRICS_MAX_ACCEPT_PER_POLL = 4;
+
+type
+  tmetricevent = (meButtonCheck, meConfigCheck, meDS4Check, meDS4BatteryLow);
+  tmetriccounter = (mcFilesChecked, mcFilesPatched, mcFilePatchFailures,
+                    mcSysfsReads, mcSysfsWrites, mcSysfsFailures);
+
+  rLatencyHistogram = record
+    count: int64;                 // Number of events recorded
+    totalus: int64;               // Sum of all event durations in us
+    minus: int64;                 // Fastest event in us
+    maxus: int64;                 // Slowest event in us
+    buckets: array[0..METRICS_HISTOGRAM_BUCKETS - 1] of int64;
+  end;
+
+  tmetrics = class(tobject)
+    private
+    protected
+      listenfd: longint;
+      socketpath: ansistring;
+      pollTimer: tltimer;
+      startTime: int64;
+
+      histogram: array[tmetricevent] of rLatencyHistogram;
+      counter: array[tmetriccounter] of int64;
+
+      // Timer events
+      procedure PollTimerEvent(Sender: TObject);
+
+      function BuildReport: ansistring;
+      procedure ServeClient(fd: longint);
+    public
+      function StartEvent: int64;
+      procedure EndEvent(event: tmetricevent; started: int64);
+      procedure Count(c: tmetriccounter);
+
+      function Listen(path: ansistring): boolean;
+      procedure Shutdown;
+      constructor Create;
+      destructor Destroy; override;
+  end;
+
+function GetMonotonicMicroseconds: int64;
+
+implementation
+
+uses linux, unitglobal;
+
+const
+  METRIC_EVENT_NAMES: array[tmetricevent] of ansistring = (
+    'button_check', 'config_check', 'ds4_check', 'ds4_battery_low');
+  METRIC_COUNTER_NAMES: array[tmetriccounter] of ansistring = (
+    'files_checked', 'files_patched', 'file_patch_failures',
+    'sysfs_reads', 'sysfs_writes', 'sysfs_failures');
+
+{ ---------------------------------------------------------------------------
+  Return a monotonic timestamp in microseconds. The Pi has no RTC, so the
+  wall clock can jump when NTP syncs; never use it to measure durations.
+  --------------------------------------------------------------------------- }
+function GetMonotonicMicroseconds: int64;
+var
+  ts: ttimespec;
+begin
+  clock_gettime(CLOCK_MONOTONIC, @ts);
+  result := (int64(ts.tv_sec) * 1000000) + (ts.tv_nsec div 1000);
+end;
+
+{ ---------------------------------------------------------------------------
+  Mark the start of a timed event. Pass the result to EndEvent.
+  --------------------------------------------------------------------------- }
+function tmetrics.StartEvent: int64;
+begin
+  result := GetMonotonicMicroseconds;
+end;
+
+{ ---------------------------------------------------------------------------
+  Record the duration of an event started with StartEvent.
+  --------------------------------------------------------------------------- }
+procedure tmetrics.EndEvent(event: tmetricevent; started: int64);
+var
+  elapsed, v: int64;
+  bucket: longint;
+begin
+  elapsed := GetMonotonicMicroseconds - started;
+  if elapsed < 0 then elapsed := 0;
+
+  // Find the log2 bucket
+  bucket := 0;
+  v := elapsed;
+  while (v > 0) and (bucket < METRICS_HISTOGRAM_BUCKETS - 1) do begin
+    v := v shr 1;
+    inc(bucket);
+  end;
+
+  inc(self.histogram[event].count);
+  inc(self.histogram[event].totalus, elapsed);
+  inc(self.histogram[event].buckets[bucket]);
+  if (self.histogram[event].count = 1) or (elapsed < self.histogram[event].minus) then begin
+    self.histogram[event].minus := elapsed;
+  end;
+  if elapsed > self.histogram[event].maxus then begin
+    self.histogram[event].maxus := elapsed;
+  end;
+end;
+
+{ ---------------------------------------------------------------------------
+  Increment a counter.
+  --------------------------------------------------------------------------- }
+procedure tmetrics.Count(c: tmetriccounter);
+begin
+  inc(self.counter[c]);
+end;
+
+{ ---------------------------------------------------------------------------
+  Build the plain text report sent to clients.
+  --------------------------------------------------------------------------- }
+function tmetrics.BuildReport: ansistring;
+var
+  e: tmetricevent;
+  c: tmetriccounter;
+  i: longint;
+  avg: int64;
+begin
+  result := 'uptime_us ' + inttostr(GetMonotonicMicroseconds - self.startTime) + #10;
+
+  for c := low(tmetriccounter) to high(tmetriccounter) do begin
+    result := result + 'counter ' + METRIC_COUNTER_NAMES[c] + ' ' + inttostr(self.counter[c]) + #10;
+  end;
+
+  for e := low(tmetricevent) to high(tmetricevent) do begin
+    avg := 0;
+    if self.histogram[e].count > 0 then begin
+      avg := self.histogram[e].totalus div self.histogram[e].count;
+    end;
+    result := result + 'event ' + METRIC_EVENT_NAMES[e] +
+              ' count ' + inttostr(self.histogram[e].count) +
+              ' total_us ' + inttostr(self.histogram[e].totalus) +
+              ' avg_us ' + inttostr(avg) +
+              ' min_us ' + inttostr(self.histogram[e].minus) +
+              ' max_us ' + inttostr(self.histogram[e].maxus) + #10;
+    // Only list non-empty buckets to keep the report short
+    for i := 0 to METRICS_HISTOGRAM_BUCKETS - 1 do begin
+      if self.histogram[e].buckets[i] > 0 then begin
+        if i = METRICS_HISTOGRAM_BUCKETS - 1 then begin
+          result := result + 'bucket ' + METRIC_EVENT_NAMES[e] + ' ge_us ' +
+                    inttostr(int64(1) shl (i - 1)) + ' ' + inttostr(self.histogram[e].buckets[i]) + #10;
+        end else begin
+          result := result + 'bucket ' + METRIC_EVENT_NAMES[e] + ' lt_us ' +
+                    inttostr(int64(1) shl i) + ' ' + inttostr(self.histogram[e].buckets[i]) + #10;
+        end;
+      end;
+    end;
+  end;
+end;
+
+{ ---------------------------------------------------------------------------
+  Send the report to a newly accepted client and hang up. The report is a
+  few KB at most so it always fits in the socket buffer; if a client is
+  somehow not draining it we just drop the rest rather than block the loop.
+  --------------------------------------------------------------------------- }
+procedure tmetrics.ServeClient(fd: longint);
+var
+  s: ansistring;
+begin
+  s := self.BuildReport;
+  fpsend(fd, @s[1], length(s), MSG_DONTWAIT or MSG_NOSIGNAL);
+  fpclose(fd);
+end;
+
+{ ---------------------------------------------------------------------------
+  Timer: Accept pending metrics clients
+  --------------------------------------------------------------------------- }
+procedure tmetrics.PollTimerEvent(Sender: TObject);
+var
+  fd, i: longint;
+begin
+  self.pollTimer.enabled := false;
+
+  // The listening socket is non-blocking, so this returns -1 straight away
+  // when nobody is waiting.
+  for i := 1 to METRICS_MAX_ACCEPT_PER_POLL do begin
+    fd := fpaccept(self.listenfd, nil, nil);
+    if fd < 0 then break;
+    self.ServeClient(fd);
+  end;
+
+  self.pollTimer.enabled := true;
+end;
+
+{ ---------------------------------------------------------------------------
+  Start serving metrics on the Unix domain socket <path>. Put it on a tmpfs
+  (such as /run) to avoid touching the SD card. Returns True on success.
+  --------------------------------------------------------------------------- }
+function tmetrics.Listen(path: ansistring): boolean;
+var
+  addr: TUnixSockAddr;
+  info: stat;
+begin
+  result := false;
+  if length(path) >= sizeof(addr.path) then begin
+    writeln('tmetrics: Socket path is too long: ' + path);
+    exit;
+  end;
+
+  // Remove a stale socket left behind by a previous run, but never delete
+  // anything that is not a socket.
+  if fpstat(path, info) = 0 then begin
+    if not fpS_ISSOCK(info.st_mode) then begin
+      writeln('tmetrics: Refusing to replace non-socket file: ' + path);
+      exit;
+    end;
+    fpunlink(path);
+  end;
+
+  self.listenfd := fpsocket(AF_UNIX, SOCK_STREAM, 0);
+  if self.listenfd < 0 then begin
+    writeln('tmetrics: Failed to create socket.');
+    exit;
+  end;
+
+  fillchar(addr, sizeof(addr), 0);
+  addr.family := AF_UNIX;
+  move(path[1], addr.path[0], length(path));
+  if (fpbind(self.listenfd, psockaddr(@addr), sizeof(addr)) <> 0) or
+     (fplisten(self.listenfd, METRICS_MAX_ACCEPT_PER_POLL) <> 0) then begin
+    writeln('tmetrics: Failed to listen on ' + path + ' (errno ' + inttostr(socketerror) + ')');
+    fpclose(self.listenfd);
+    self.listenfd := -1;
+    exit;
+  end;
+  fpfcntl(self.listenfd, F_SETFL, fpfcntl(self.listenfd, F_GETFL) or O_NONBLOCK);
+  self.socketpath := path;
+
+  self.pollTimer := tltimer.Create(nil);
+  self.pollTimer.onTimer := self.PollTimerEvent;
+  self.pollTimer.interval := METRICS_POLL_INTERVAL;
+  self.pollTimer.enabled := true;
+
+  result := true;
+end;
+
+{ ---------------------------------------------------------------------------
+  Stop serving metrics and remove the socket.
+  --------------------------------------------------------------------------- }
+procedure tmetrics.Shutdown;
+begin
+  if assigned(self.pollTimer) then begin
+    self.pollTimer.onTimer := nil;
+    self.pollTimer.enabled := false;
+    self.pollTimer.release;
+    self.pollTimer := nil;
+  end;
+  if self.listenfd >= 0 then begin
+    fpclose(self.listenfd);
+    self.listenfd := -1;
+    fpunlink(self.socketpath);
+  end;
+end;
+
+{ ----------------------------------------------------------------------------
+  tmetrics constructor
+  ---------------------------------------------------------------------------- }
+constructor tmetrics.Create;
+begin
+  inherited Create;
+
+  self.listenfd := -1;
+  self.socketpath := '';
+  self.pollTimer := nil;
+  self.startTime := GetMonotonicMicroseconds;
+  fillchar(self.histogram, sizeof(self.histogram), 0);
+  fillchar(self.counter, sizeof(self.counter), 0);
+end;
+
+{ ----------------------------------------------------------------------------
+  tmetrics destructor
+  ---------------------------------------------------------------------------- }
+destructor tmetrics.Destroy;
+begin
+  self.Shutdown;
+  inherited Destroy;
+end;
+
+{ ----------------------------------------------------------------------------
+  ---------------------------------------------------------------------------- }
+end.